@@ -13,8 +13,10 @@ AccelerationStructureBuilder::SharedPtr AccelerationStructureBuilder::Create(Buf
 
 void AccelerationStructureBuilder::BuildAS(RenderContext* pContext, uint32_t rayTypeCount)
 {
-    mRebuildBlas = true;
-    InitGeomDesc();
+    if (mRebuildBlas)
+    {
+        InitGeomDesc();
+    }
     BuildBlas(pContext);
     BuildTlas(pContext, rayTypeCount, true);
 }
@@ -25,6 +27,20 @@ void AccelerationStructureBuilder::SetRaytracingShaderData(const ShaderVar& var,
     var[name].setSrv(tlasIt->second.pSrv);
 }
 
+uint64_t AccelerationStructureBuilder::GetMemoryUsage() const
+{
+    uint64_t size = 0;
+    if (mpBlas) size += mpBlas->getSize();
+    if (mpBlasScratch) size += mpBlasScratch->getSize();
+    if (mpTlasScratch) size += mpTlasScratch->getSize();
+    for (const auto& [rayCount, tlas] : mTlasCache)
+    {
+        if (tlas.pTlas) size += tlas.pTlas->getSize();
+        if (tlas.pInstanceDescs) size += tlas.pInstanceDescs->getSize();
+    }
+    return size;
+}
+
 void AccelerationStructureBuilder::InitGeomDesc()
 {
     mBlasData.resize(1);
@@ -62,12 +78,11 @@ void AccelerationStructureBuilder::BuildBlas(RenderContext* pContext)
 {
     pContext->resourceBarrier(m_BoundingBoxBuffer.get(), Resource::State::NonPixelShader);
 
-    // On the first time, or if a full rebuild is necessary we will:
+    // The AABBs are rewritten every frame but their count and location never change, so on the first build we:
     // - Update all build inputs and prebuild info
-    // - Calculate total intermediate buffer sizes
-    // - Build all BLASes into an intermediate buffer
-    // - Calculate total compacted buffer size
-    // - Compact/clone all BLASes to their final location
+    // - Allocate the BLAS and scratch buffers at their maximum size
+    // Every build after that goes straight into the same buffers. The BLASes are not compacted, compaction needs
+    // the postbuild size read back on the CPU, which would stall the GPU twice per frame.
     if (mRebuildBlas)
     {
         uint64_t totalMaxBlasSize = 0;
@@ -81,7 +96,7 @@ void AccelerationStructureBuilder::BuildBlas(RenderContext* pContext)
             inputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
             inputs.NumDescs = (uint32_t)blas.geomDescs.size();
             inputs.pGeometryDescs = blas.geomDescs.data();
-            inputs.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_NONE;
+            inputs.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_BUILD;
 
             // Get prebuild info.
             FALCOR_GET_COM_INTERFACE(gpDevice->getApiHandle(), ID3D12Device5, pDevice5);
@@ -89,6 +104,7 @@ void AccelerationStructureBuilder::BuildBlas(RenderContext* pContext)
 
             // Figure out the padded allocation sizes to have proper alignement.
             uint64_t paddedMaxBlasSize = align_to((uint64_t)D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT, blas.prebuildInfo.ResultDataMaxSizeInBytes);
+            blas.blasByteSize = blas.prebuildInfo.ResultDataMaxSizeInBytes;
             blas.blasByteOffset = totalMaxBlasSize;
             totalMaxBlasSize += paddedMaxBlasSize;
 
@@ -98,119 +114,40 @@ void AccelerationStructureBuilder::BuildBlas(RenderContext* pContext)
             totalScratchSize += paddedScratchSize;
         }
 
-        // Allocate intermediate buffers and scratch buffer.
-        // The scratch buffer we'll retain because it's needed for subsequent rebuilds and updates.
-        // TODO: Save memory by reducing the scratch buffer to the minimum required for the dynamic objects.
         if (mpBlasScratch == nullptr || mpBlasScratch->getSize() < totalScratchSize)
         {
             mpBlasScratch = Buffer::create(totalScratchSize, Buffer::BindFlags::UnorderedAccess, Buffer::CpuAccess::None);
         }
-        else
-        {
-            // If we didn't need to reallocate, just insert a barrier so it's safe to use.
-            pContext->uavBarrier(mpBlasScratch.get());
-        }
-
-        Buffer::SharedPtr pDestBuffer = Buffer::create(totalMaxBlasSize, Buffer::BindFlags::AccelerationStructure, Buffer::CpuAccess::None);
-
-        const size_t postBuildInfoSize = sizeof(D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_COMPACTED_SIZE_DESC);
-        static_assert(postBuildInfoSize == sizeof(D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_CURRENT_SIZE_DESC));
-
-        size_t totalPostBuildInfoSize = mBlasData.size() * postBuildInfoSize;
-
-        Buffer::SharedPtr pPostbuildInfoBuffer = Buffer::create(totalPostBuildInfoSize, ResourceBindFlags::UnorderedAccess, Buffer::CpuAccess::None);
-        Buffer::SharedPtr pPostbuildInfoStagingBuffer = Buffer::create(totalPostBuildInfoSize, Buffer::BindFlags::None, Buffer::CpuAccess::Read);
-
-        // Build the BLASes into the intermediate destination buffer.
-        // We output postbuild info to a separate buffer to find out the final size requirements.
-        assert(pDestBuffer && pPostbuildInfoBuffer && mpBlasScratch);
-        uint64_t postBuildInfoOffset = 0;
-
-        for (const auto& blas : mBlasData)
-        {
-            D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC asDesc = {};
-            asDesc.Inputs = blas.buildInputs;
-            asDesc.ScratchAccelerationStructureData = mpBlasScratch->getGpuAddress() + blas.scratchByteOffset;
-            asDesc.DestAccelerationStructureData = pDestBuffer->getGpuAddress() + blas.blasByteOffset;
-
-            // Need to find out the the postbuild compacted BLAS size to know the final allocation size.
-            D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_DESC postbuildInfoDesc = {};
-            postbuildInfoDesc.InfoType = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_CURRENT_SIZE;
-            postbuildInfoDesc.DestBuffer = pPostbuildInfoBuffer->getGpuAddress() + postBuildInfoOffset;
-            postBuildInfoOffset += postBuildInfoSize;
-
-            FALCOR_GET_COM_INTERFACE(pContext->getLowLevelData()->getCommandList(), ID3D12GraphicsCommandList4, pList4);
-            pList4->BuildRaytracingAccelerationStructure(&asDesc, 1, &postbuildInfoDesc);
-        }
 
-        mpBlasScratch.reset();
-        // TODO Remove This Flush
-        pContext->flush(true);
-        pContext->copyResource(pPostbuildInfoStagingBuffer.get(), pPostbuildInfoBuffer.get());
-        pContext->flush(true);
-
-        // Read back the calculated final size requirements for each BLAS.
-        // For this purpose we have to flush and map the postbuild info buffer for readback.
-        // TODO: We could copy to a staging buffer first and wait on a GPU fence for when it's ready.
-        // But there is no other work to do inbetween so it probably wouldn't help. This is only done once at startup anyway.
-        const D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_COMPACTED_SIZE_DESC* postBuildInfo =
-            (const D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_COMPACTED_SIZE_DESC*)pPostbuildInfoStagingBuffer->map(Buffer::MapType::Read);
-
-        uint64_t totalBlasSize = 0;
-        for (size_t i = 0; i < mBlasData.size(); i++)
+        if (mpBlas == nullptr || mpBlas->getSize() < totalMaxBlasSize)
         {
-            auto& blas = mBlasData[i];
-            blas.blasByteSize = postBuildInfo[i].CompactedSizeInBytes;
-            assert(blas.blasByteSize <= blas.prebuildInfo.ResultDataMaxSizeInBytes);
-            uint64_t paddedBlasSize = align_to((uint64_t)D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT, blas.blasByteSize);
-            totalBlasSize += paddedBlasSize;
+            mpBlas = Buffer::create(totalMaxBlasSize, Buffer::BindFlags::AccelerationStructure, Buffer::CpuAccess::None);
         }
-        pPostbuildInfoStagingBuffer->unmap();
 
-        // Allocate final BLAS buffer.
-        if (mpBlas == nullptr || mpBlas->getSize() < totalBlasSize)
-        {
-            mpBlas = Buffer::create(totalBlasSize, Buffer::BindFlags::AccelerationStructure, Buffer::CpuAccess::None);
-        }
-        else
-        {
-            // If we didn't need to reallocate, just insert a barrier so it's safe to use.
-            pContext->uavBarrier(mpBlas.get());
-        }
-
-        // Insert barriers for the intermediate buffer. This is probably not necessary since we flushed above, but it's not going to hurt.
-        pContext->uavBarrier(pDestBuffer.get());
-
-        // Compact/clone all BLASes to their final location.
-        uint64_t blasOffset = 0;
-        for (auto& blas : mBlasData)
-        {
-            FALCOR_GET_COM_INTERFACE(pContext->getLowLevelData()->getCommandList(), ID3D12GraphicsCommandList4, pList4);
-            pList4->CopyRaytracingAccelerationStructure(
-                mpBlas->getGpuAddress() + blasOffset,
-                pDestBuffer->getGpuAddress() + blas.blasByteOffset,
-                D3D12_RAYTRACING_ACCELERATION_STRUCTURE_COPY_MODE_CLONE);
-
-            uint64_t paddedBlasSize = align_to((uint64_t)D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT, blas.blasByteSize);
-            blas.blasByteOffset = blasOffset;
-            blasOffset += paddedBlasSize;
-        }
-        assert(blasOffset == totalBlasSize);
-
-        // Insert barrier. The BLAS buffer is now ready for use.
+        mRebuildBlas = false;
+    }
+    else
+    {
+        // The previous build and the TLAS built on top of it must be done with the buffers before we overwrite them.
+        pContext->uavBarrier(mpBlasScratch.get());
         pContext->uavBarrier(mpBlas.get());
+    }
 
-        // UpdateRaytracingStats();
-        mRebuildBlas = false;
+    assert(mpBlas && mpBlasScratch);
+
+    for (const auto& blas : mBlasData)
+    {
+        D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC asDesc = {};
+        asDesc.Inputs = blas.buildInputs;
+        asDesc.ScratchAccelerationStructureData = mpBlasScratch->getGpuAddress() + blas.scratchByteOffset;
+        asDesc.DestAccelerationStructureData = mpBlas->getGpuAddress() + blas.blasByteOffset;
 
-        return;
+        FALCOR_GET_COM_INTERFACE(pContext->getLowLevelData()->getCommandList(), ID3D12GraphicsCommandList4, pList4);
+        pList4->BuildRaytracingAccelerationStructure(&asDesc, 0, nullptr);
     }
 
-    // If we get here, all BLASes have previously been built and compacted. We will:
-    // - Early out if there are no animated meshes.
-    // - Update or rebuild in-place the ones that are animated.
-    assert(!mRebuildBlas);
-    return;
+    // Insert barrier. The BLAS buffer is now ready for use.
+    pContext->uavBarrier(mpBlas.get());
 }
 
 void AccelerationStructureBuilder::FillInstanceDesc(std::vector<D3D12_RAYTRACING_INSTANCE_DESC>& instanceDescs, uint32_t rayCount, bool perMeshHitEntry)
@@ -274,8 +211,9 @@ void AccelerationStructureBuilder::BuildTlas(RenderContext* pContext, uint32_t r
     //// Else update instance descs and barrier TLAS buffers
     else
     {
-        //pContext->uavBarrier(tlas.pTlas.get());
-        //pContext->uavBarrier(mpTlasScratch.get());
+        // Without the per-frame flushes these barriers order the rebuild after the previous frame's build and ray queries.
+        pContext->uavBarrier(tlas.pTlas.get());
+        pContext->uavBarrier(mpTlasScratch.get());
         tlas.pInstanceDescs->setBlob(mInstanceDescs.data(), 0, inputs.NumDescs * sizeof(D3D12_RAYTRACING_INSTANCE_DESC));
 
         // asDesc.Inputs.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE;
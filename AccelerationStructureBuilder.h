@@ -14,6 +14,8 @@ public:
 
     void SetRaytracingShaderData(const ShaderVar& var, const std::string name, uint32_t rayTypeCount);
 
+    uint64_t GetMemoryUsage() const;
+
 private:
 
     void InitGeomDesc();
@@ -27,15 +27,22 @@
  **************************************************************************/
 #include "ProgressivePhotonMapping.h"
 #include "ShadingDataLoader.h"
+#include <glm/gtc/packing.hpp>
 
 const RenderPass::Info ProgressivePhotonMapping::kInfo { "ProgressivePhotonMapping", "Insert pass description here." };
 
 const std::string kGenerateVisiblePointsFile = "RenderPasses/ProgressivePhotonMapping/GenerateVisiblePoints.cs.slang";
+const std::string kEmitPhotonsFile = "RenderPasses/ProgressivePhotonMapping/EmitPhotons.cs.slang";
 const std::string kGeneratePhotonsFile = "RenderPasses/ProgressivePhotonMapping/GeneratePhotons.cs.slang";
 const std::string kReduceRadiusFile = "RenderPasses/ProgressivePhotonMapping/ReduceRadius.cs.slang";
 const std::string kResolvePassFile = "RenderPasses/ProgressivePhotonMapping/ResolvePass.cs.slang";
 const std::string kShaderModel = "6_5";
 
+// Alpha has to stay above 0, alpha = 0 collapses the radius to 0 on the first reduction.
+const float kMinAlpha = 0.01f;
+// Same for the initial radius, a zero radius gives degenerate AABBs that never gather a photon.
+const float kMinInitialRadius = 1e-5f;
+
 const ChannelList kInputChannels =
 {
     { "vbuffer",    "",     "Visibility buffer in packed format",   false, HitInfo::kDefaultFormat },
@@ -44,7 +51,27 @@ const ChannelList kInputChannels =
 const ChannelList kOutputChannels =
 {
     { "color",      "",     "Output color", false, ResourceFormat::RGBA32Float},
+    { "color1",     "",     "Output color of view 1", true, ResourceFormat::RGBA32Float},
+    { "color2",     "",     "Output color of view 2", true, ResourceFormat::RGBA32Float},
+    { "color3",     "",     "Output color of view 3", true, ResourceFormat::RGBA32Float},
 };
+static_assert(kMaxViewCount == 4);
+
+// Scripting options.
+const char kPhotonPerDispatch[] = "photonPerDispatch";
+const char kPhotonPassCount[] = "photonPassCount";
+const char kAlpha[] = "alpha";
+const char kInitialRadius[] = "initialRadius";
+const char kMaxVisiblePointBounces[] = "maxVisiblePointBounces";
+const char kMaxPhotonBounces[] = "maxPhotonBounces";
+const char kTrackConvergence[] = "trackConvergence";
+const char kConvergenceThreshold[] = "convergenceThreshold";
+const char kFreezeConverged[] = "freezeConverged";
+const char kTargetError[] = "targetError";
+const char kViewCount[] = "viewCount";
+const char kSamplesPerPixel[] = "samplesPerPixel";
+const char kPhotonMemoryBudget[] = "photonMemoryBudget";
+const char kSortPhotonEmission[] = "sortPhotonEmission";
 
 // Don't remove this. it's required for hot-reload to function properly
 extern "C" FALCOR_API_EXPORT const char* getProjDir()
@@ -52,9 +79,19 @@ extern "C" FALCOR_API_EXPORT const char* getProjDir()
     return PROJECT_DIR;
 }
 
+void regProgressivePhotonMapping(pybind11::module& m)
+{
+    pybind11::class_<ProgressivePhotonMapping, RenderPass, ProgressivePhotonMapping::SharedPtr> pass(m, "ProgressivePhotonMapping");
+    pass.def_property_readonly("frameError", &ProgressivePhotonMapping::getFrameError);
+    pass.def_property_readonly("convergedRatio", &ProgressivePhotonMapping::getConvergedRatio);
+    pass.def_property_readonly("converged", &ProgressivePhotonMapping::isConverged);
+    pass.def_property_readonly("photonPassesUsed", &ProgressivePhotonMapping::getPhotonPassesUsed);
+}
+
 extern "C" FALCOR_API_EXPORT void getPasses(Falcor::RenderPassLibrary& lib)
 {
     lib.registerPass(ProgressivePhotonMapping::kInfo, ProgressivePhotonMapping::create);
+    ScriptBindings::registerBinding(regProgressivePhotonMapping);
 }
 
 ProgressivePhotonMapping::ProgressivePhotonMapping() : RenderPass(kInfo)
@@ -67,9 +104,12 @@ ProgressivePhotonMapping::ProgressivePhotonMapping() : RenderPass(kInfo)
     defines.add("_DEFAULT_ALPHA_TEST");
 
     mpGenerateVisiblePointsPass = ComputePass::create(Program::Desc(kGenerateVisiblePointsFile).setShaderModel(kShaderModel).csEntry("main"), defines, false);
+    mpEmitPhotonsPass = ComputePass::create(Program::Desc(kEmitPhotonsFile).setShaderModel(kShaderModel).csEntry("main"), defines, false);
     mpGeneratePhotonsPass = ComputePass::create(Program::Desc(kGeneratePhotonsFile).setShaderModel(kShaderModel).csEntry("main"), defines, false);
     mpReduceRadiusPass = ComputePass::create(Program::Desc(kReduceRadiusFile).setShaderModel(kShaderModel).csEntry("main"), defines, false);
     mpResolvePass = ComputePass::create(Program::Desc(kResolvePassFile).setShaderModel(kShaderModel).csEntry("main"), defines, false);
+
+    mpBitonicSort = BitonicSort::create();
 }
 
 void ProgressivePhotonMapping::setParamShaderData(const ShaderVar& var)
@@ -81,6 +121,14 @@ void ProgressivePhotonMapping::setParamShaderData(const ShaderVar& var)
     var["photonCount"] = mParams.photonCount;
     var["photonPassIndex"] = mParams.photonPassIndex;
     var["alpha"] = mParams.alpha;
+    var["convergenceThreshold"] = mParams.convergenceThreshold;
+    var["trackConvergence"] = mParams.trackConvergence;
+    var["freezeConverged"] = mParams.freezeConverged;
+    var["viewCount"] = mParams.viewCount;
+    var["samplesPerPixel"] = mParams.samplesPerPixel;
+    var["maxVisiblePointBounces"] = mParams.maxVisiblePointBounces;
+    var["maxPhotonBounces"] = mParams.maxPhotonBounces;
+    var["initialRadius"] = mParams.initialRadius;
 }
 
 ProgressivePhotonMapping::SharedPtr ProgressivePhotonMapping::create(RenderContext* pRenderContext, const Dictionary& dict)
@@ -88,7 +136,21 @@ ProgressivePhotonMapping::SharedPtr ProgressivePhotonMapping::create(RenderConte
     SharedPtr pPass = SharedPtr(new ProgressivePhotonMapping());
     for (const auto& [key, value] : dict)
     {
-        logWarning("Unknown field '" + key + "' in a ProgressivePhotonMapping dictionary");
+        if (key == kPhotonPerDispatch) pPass->mParams.photonPerDispatch = std::max((uint)value, 1u);
+        else if (key == kPhotonPassCount) pPass->mParams.photonPassCount = std::max((uint)value, 1u);
+        else if (key == kAlpha) pPass->mParams.alpha = std::clamp((float)value, kMinAlpha, 1.0f);
+        else if (key == kInitialRadius) pPass->mParams.initialRadius = std::max((float)value, kMinInitialRadius);
+        else if (key == kMaxVisiblePointBounces) pPass->mParams.maxVisiblePointBounces = std::max((uint)value, 1u);
+        else if (key == kMaxPhotonBounces) pPass->mParams.maxPhotonBounces = std::max((uint)value, 1u);
+        else if (key == kTrackConvergence) pPass->mTrackConvergence = value;
+        else if (key == kConvergenceThreshold) pPass->mParams.convergenceThreshold = value;
+        else if (key == kFreezeConverged) pPass->mFreezeConverged = value;
+        else if (key == kTargetError) pPass->mTargetError = value;
+        else if (key == kSamplesPerPixel) pPass->mSamplesPerPixel = std::clamp((uint)value, 1u, kMaxSamplesPerPixel);
+        else if (key == kPhotonMemoryBudget) pPass->mPhotonMemoryBudget = std::max((uint)value, 1u);
+        else if (key == kSortPhotonEmission) pPass->mSortEmission = value;
+        else if (key == kViewCount) pPass->mViewCount = std::clamp((uint)value, 1u, kMaxViewCount);
+        else logWarning("Unknown field '" + key + "' in a ProgressivePhotonMapping dictionary");
     }
     return pPass;
 }
@@ -96,6 +158,20 @@ ProgressivePhotonMapping::SharedPtr ProgressivePhotonMapping::create(RenderConte
 Dictionary ProgressivePhotonMapping::getScriptingDictionary()
 {
     Dictionary dict;
+    dict[kPhotonPerDispatch] = mParams.photonPerDispatch;
+    dict[kPhotonPassCount] = mParams.photonPassCount;
+    dict[kAlpha] = mParams.alpha;
+    dict[kInitialRadius] = mParams.initialRadius;
+    dict[kMaxVisiblePointBounces] = mParams.maxVisiblePointBounces;
+    dict[kMaxPhotonBounces] = mParams.maxPhotonBounces;
+    dict[kTrackConvergence] = mTrackConvergence;
+    dict[kConvergenceThreshold] = mParams.convergenceThreshold;
+    dict[kFreezeConverged] = mFreezeConverged;
+    dict[kTargetError] = mTargetError;
+    dict[kViewCount] = mViewCount;
+    dict[kPhotonMemoryBudget] = mPhotonMemoryBudget;
+    dict[kSortPhotonEmission] = mSortEmission;
+    dict[kSamplesPerPixel] = mSamplesPerPixel;
     return dict;
 }
 
@@ -125,10 +201,33 @@ void ProgressivePhotonMapping::execute(RenderContext* pRenderContext, const Rend
 
     generateVisiblePoints(pRenderContext, renderData);
 
+    // With a target error the frame stops tracing photon passes as soon as it is reached,
+    // photonPassCount then only acts as an upper bound.
+    const bool earlyTermination = mTrackConvergence && mTargetError > 0.0f;
+    mPhotonPassesUsed = 0u;
     for (uint i = 0; i < mParams.photonPassCount; i++)
     {
         generatePhotons(pRenderContext, renderData);
         reduceRadius(pRenderContext, renderData);
+        mPhotonPassesUsed++;
+
+        if (earlyTermination)
+        {
+            // Decide on the stats of the previous pass, the CPU only waits for them while this pass runs on the GPU.
+            requestConvergenceStats(pRenderContext);
+            readConvergenceStats(1u);
+            if (mConvergenceStatsFrame == mParams.frameCount && isConverged())
+            {
+                break;
+            }
+        }
+    }
+
+    if (mTrackConvergence && !earlyTermination)
+    {
+        // Only displayed, picked up without waiting once the GPU got there.
+        requestConvergenceStats(pRenderContext);
+        readConvergenceStats(kConvergenceStatsReadbackCount);
     }
 
     resolve(pRenderContext, renderData);
@@ -138,7 +237,53 @@ void ProgressivePhotonMapping::execute(RenderContext* pRenderContext, const Rend
 
 void ProgressivePhotonMapping::renderUI(Gui::Widgets& widget)
 {
+    widget.var("Photons Per Pass", mParams.photonPerDispatch, 1u, 1u << 26, 1000u);
     widget.var("Photon Pass Count", mParams.photonPassCount, 1u, 20u);
+    widget.var("Alpha", mParams.alpha, kMinAlpha, 1.0f, 0.01f);
+    widget.tooltip("Fraction of the new photons kept in each radius reduction, smaller values shrink the radius faster.", true);
+    widget.var("Initial Radius", mParams.initialRadius, kMinInitialRadius, 1.0f, 0.0001f);
+    widget.var("Max Visible Point Bounces", mParams.maxVisiblePointBounces, 1u, 32u);
+    widget.var("Max Photon Bounces", mParams.maxPhotonBounces, 1u, 32u);
+    widget.var("Samples Per Pixel", mSamplesPerPixel, 1u, kMaxSamplesPerPixel);
+    widget.tooltip("Visible points per pixel. They use jittered camera rays and their own bounce choices, resolve averages their photon estimates.", true);
+    widget.var("View Count", mViewCount, 1u, kMaxViewCount);
+    widget.tooltip("Additional views use the next scene cameras and the colorN outputs, they share the photons of the main view.", true);
+    widget.text("Active views: " + std::to_string(mParams.viewCount));
+
+    if (auto group = widget.group("Memory", false))
+    {
+        group.var("Photon Memory Budget (MB)", mPhotonMemoryBudget, 1u, 4096u);
+        group.tooltip("Upper bound for the emission buffers. Photon passes that do not fit are streamed through them in chunks.", true);
+        group.checkbox("Sort Photon Emission", mSortEmission);
+        group.tooltip("Sorts the emission samples of each group of 256 photons by light triangle and direction before tracing, for more coherent traversal.", true);
+
+        const uint64_t emissionBytes = mpEmissionSamples ? mpEmissionSamples->getSize() + mpEmissionSortKeys->getSize() : 0;
+        std::ostringstream oss;
+        oss << "Photon chunks per pass: " << getPhotonChunkCount() << " x " << getPhotonChunkSize() << "\n"
+            << "Emission buffers: " << emissionBytes / (1024.0 * 1024.0) << " MB\n"
+            << "Total pass memory: " << getMemoryUsage() / (1024.0 * 1024.0) << " MB";
+        group.text(oss.str());
+    }
+
+    if (auto group = widget.group("Convergence", true))
+    {
+        group.checkbox("Track Convergence", mTrackConvergence);
+        group.tooltip("Keeps a running relative error per visible point and reads back a frame level error after the photon passes.", true);
+        if (mTrackConvergence)
+        {
+            group.var("Convergence Threshold", mParams.convergenceThreshold, 0.0f, 1.0f, 0.001f);
+            group.checkbox("Freeze Converged Points", mFreezeConverged);
+            group.tooltip("Converged visible points are skipped by the photon gather and the radius reduction.", true);
+            group.var("Target Error", mTargetError, 0.0f, 1.0f, 0.001f);
+            group.tooltip("Stops the photon passes of a frame once the frame error drops below this value. 0 disables early termination.", true);
+
+            std::ostringstream oss;
+            oss << "Frame error: " << getFrameError() << "\n"
+                << "Converged points: " << getConvergedRatio() * 100.0f << "%\n"
+                << "Photon passes: " << mPhotonPassesUsed << "/" << mParams.photonPassCount;
+            group.text(oss.str());
+        }
+    }
 }
 
 void ProgressivePhotonMapping::setScene(RenderContext* pRenderContext, const Scene::SharedPtr& pScene)
@@ -151,25 +296,122 @@ void ProgressivePhotonMapping::beginFrame(RenderContext* pRenderContext, const R
     const auto& pOutputColor = renderData[kOutputChannels[0].name]->asTexture();
     mParams.frameDim = uint2(pOutputColor->getWidth(), pOutputColor->getHeight());
     mParams.seed = mParams.frameCount;
-    mParams.photonCount = 0u;
+    mParams.photonCount = 0.0f;
     mParams.photonPassIndex = 0u;
+    mParams.trackConvergence = mTrackConvergence ? 1u : 0u;
+    mParams.freezeConverged = (mTrackConvergence && mFreezeConverged) ? 1u : 0u;
 
-    if (!mpVisiblePoints)
+    updateViews(renderData);
+    mParams.samplesPerPixel = mSamplesPerPixel;
+
+    const uint visiblePointCount = mParams.frameDim.x * mParams.frameDim.y * mParams.viewCount * mParams.samplesPerPixel;
+    if (!mpVisiblePoints || mpVisiblePoints->getElementCount() != visiblePointCount)
     {
-        mpVisiblePoints = Buffer::createStructured(sizeof(VisiblePoint), mParams.frameDim.x * mParams.frameDim.y);
+        mpVisiblePoints = Buffer::createStructured(sizeof(VisiblePoint), visiblePointCount);
         mpVisiblePoints->setName("Visible Points Buffer");
 
-        mpVisiblePointPhotonNumbers = Buffer::createStructured(sizeof(uint), mParams.frameDim.x * mParams.frameDim.y);
+        mpVisiblePointPhotonNumbers = Buffer::createStructured(sizeof(uint), visiblePointCount);
         mpVisiblePointPhotonNumbers->setName("Visible Point Photon Number Buffer");
 
-        mpVisiblePointDensityContexts = Buffer::createStructured(sizeof(VisiblePointDensityContext), mParams.frameDim.x * mParams.frameDim.y);
+        mpVisiblePointDensityContexts = Buffer::createStructured(sizeof(VisiblePointDensityContext), visiblePointCount);
         mpVisiblePointDensityContexts->setName("Visible Point Density Context Buffer");
 
-        mpVisiblePointsBoundingBoxBuffer = Buffer::createStructured(sizeof(float) * 8llu, mParams.frameDim.x * mParams.frameDim.y);
+        mpVisiblePointConvergenceContexts = Buffer::createStructured(sizeof(VisiblePointConvergenceContext), visiblePointCount);
+        mpVisiblePointConvergenceContexts->setName("Visible Point Convergence Context Buffer");
+
+        mpVisiblePointsBoundingBoxBuffer = Buffer::createStructured(sizeof(float) * 8llu, visiblePointCount);
         mpVisiblePointsBoundingBoxBuffer->setName("Visible Points Bounding Box Buffer");
 
-        mpVisiblePointsAS = AccelerationStructureBuilder::Create(mpVisiblePointsBoundingBoxBuffer, mParams.frameDim.x * mParams.frameDim.y);
+        mpVisiblePointsAS = AccelerationStructureBuilder::Create(mpVisiblePointsBoundingBoxBuffer, visiblePointCount);
     }
+
+    const uint photonChunkSize = getPhotonChunkSize();
+    if (!mpEmissionSamples || mpEmissionSamples->getElementCount() != photonChunkSize)
+    {
+        mpEmissionSamples = Buffer::createStructured(sizeof(EmissionSample), photonChunkSize);
+        mpEmissionSamples->setName("Emission Samples Buffer");
+        // Keys are sorted in whole groups, the emit pass pads the last group with keys that sort last.
+        mpEmissionSortKeys = Buffer::createTyped<uint>(getEmissionSortKeyCount(photonChunkSize));
+        mpEmissionSortKeys->setName("Emission Sort Keys Buffer");
+    }
+
+    if (!mpVisiblePointsBounds)
+    {
+        mpVisiblePointsBounds = Buffer::create(sizeof(uint) * 8llu, ResourceBindFlags::ShaderResource | ResourceBindFlags::UnorderedAccess, Buffer::CpuAccess::None);
+        mpVisiblePointsBounds->setName("Visible Points Bounds Buffer");
+    }
+
+    if (!mpConvergenceStats)
+    {
+        mpConvergenceStats = Buffer::create(sizeof(ConvergenceStats), ResourceBindFlags::ShaderResource | ResourceBindFlags::UnorderedAccess, Buffer::CpuAccess::None);
+        mpConvergenceStats->setName("Convergence Stats Buffer");
+        for (uint i = 0; i < kConvergenceStatsReadbackCount; i++)
+        {
+            mpConvergenceStatsReadback[i] = Buffer::create(sizeof(ConvergenceStats), ResourceBindFlags::None, Buffer::CpuAccess::Read);
+            mpConvergenceStatsReadback[i]->setName("Convergence Stats Readback Buffer " + std::to_string(i));
+        }
+        mpConvergenceStatsFence = GpuFence::create();
+    }
+}
+
+uint ProgressivePhotonMapping::getPhotonChunkSize() const
+{
+    // The emission samples and their sort keys.
+    const uint64_t budgetChunkSize = (uint64_t)mPhotonMemoryBudget * 1024 * 1024 / (sizeof(EmissionSample) + sizeof(uint));
+    // A chunk is traced with 1D dispatches, so it also has to stay within their thread group limit.
+    const uint64_t maxChunkSize = std::min<uint64_t>(budgetChunkSize, kMaxDispatchWidth);
+    return (uint)std::max<uint64_t>(std::min<uint64_t>(mParams.photonPerDispatch, maxChunkSize), 1);
+}
+
+uint ProgressivePhotonMapping::getEmissionSortKeyCount(uint chunkSize) const
+{
+    return div_round_up(chunkSize, kEmissionSortGroupSize) * kEmissionSortGroupSize;
+}
+
+uint64_t ProgressivePhotonMapping::getMemoryUsage() const
+{
+    uint64_t size = 0;
+    for (const auto& pBuffer : { mpVisiblePoints, mpVisiblePointPhotonNumbers, mpVisiblePointDensityContexts, mpVisiblePointConvergenceContexts,
+                                 mpVisiblePointsBoundingBoxBuffer, mpEmissionSamples, mpEmissionSortKeys, mpViewCameras })
+    {
+        if (pBuffer) size += pBuffer->getSize();
+    }
+    if (mpVisiblePointsAS) size += mpVisiblePointsAS->GetMemoryUsage();
+    return size;
+}
+
+void ProgressivePhotonMapping::updateViews(const RenderData& renderData)
+{
+    // View 0 is the active camera. Further views take the remaining scene cameras in order,
+    // as long as the matching output is connected.
+    const auto& pActiveCamera = mpScene->getCamera();
+    mViewCameras.clear();
+    mViewCameras.push_back(pActiveCamera);
+    for (const auto& pCamera : mpScene->getCameras())
+    {
+        if (mViewCameras.size() >= mViewCount || !renderData[kOutputChannels[mViewCameras.size()].name])
+        {
+            break;
+        }
+        if (pCamera != pActiveCamera)
+        {
+            mViewCameras.push_back(pCamera);
+        }
+    }
+    mParams.viewCount = (uint)mViewCameras.size();
+
+    std::vector<CameraData> cameraData;
+    for (const auto& pCamera : mViewCameras)
+    {
+        cameraData.push_back(pCamera->getData());
+    }
+
+    if (!mpViewCameras)
+    {
+        mpViewCameras = Buffer::createStructured(sizeof(CameraData), kMaxViewCount, ResourceBindFlags::ShaderResource, Buffer::CpuAccess::None, nullptr, false);
+        mpViewCameras->setName("View Cameras Buffer");
+    }
+    mpViewCameras->setBlob(cameraData.data(), 0, cameraData.size() * sizeof(CameraData));
 }
 
 void ProgressivePhotonMapping::recompile()
@@ -190,6 +432,9 @@ void ProgressivePhotonMapping::recompile()
     prepareProgram(mpGenerateVisiblePointsPass->getProgram());
     mpGenerateVisiblePointsPass->setVars(nullptr);
 
+    prepareProgram(mpEmitPhotonsPass->getProgram());
+    mpEmitPhotonsPass->setVars(nullptr);
+
     prepareProgram(mpGeneratePhotonsPass->getProgram());
     mpGeneratePhotonsPass->setVars(nullptr);
 
@@ -222,6 +467,7 @@ bool ProgressivePhotonMapping::prepareLighting(RenderContext* pRenderContext)
         if (!mpEnvMapSampler)
         {
             mpEnvMapSampler = EnvMapSampler::create(pRenderContext, mpScene->getEnvMap());
+            updateEnvRadianceIntegral(pRenderContext);
             lightingChanged = true;
             mRecompile = true;
         }
@@ -263,9 +509,11 @@ bool ProgressivePhotonMapping::prepareLighting(RenderContext* pRenderContext)
             auto lightData = lightCollection->getMeshLightTriangles();
             std::vector<float> fluxList;
             fluxList.resize(lightData.size(), 0.0f);
+            mEmissivePower = 0.0f;
             for (int i = 0; i < lightData.size(); i++)
             {
                 fluxList[i] = lightData[i].flux;
+                mEmissivePower += lightData[i].flux;
             }
             std::mt19937 rng;
             mpEmissiveTable = AliasTable::create(fluxList, rng);
@@ -296,18 +544,67 @@ bool ProgressivePhotonMapping::prepareLighting(RenderContext* pRenderContext)
     return lightingChanged;
 }
 
+void ProgressivePhotonMapping::updateEnvRadianceIntegral(RenderContext* pRenderContext)
+{
+    // The integral only steers how many photons are emitted from the env map, so a coarse mip is enough.
+    const auto& pEnvMap = mpScene->getEnvMap();
+    const auto& pTexture = pEnvMap->getEnvMap();
+    uint mipLevel = 0;
+    while (mipLevel + 1 < pTexture->getMipCount() && pTexture->getHeight(mipLevel + 1) >= 16)
+    {
+        mipLevel++;
+    }
+    const uint width = pTexture->getWidth(mipLevel);
+    const uint height = pTexture->getHeight(mipLevel);
+
+    const ResourceFormat format = pTexture->getFormat();
+    const uint channelCount = getFormatChannelCount(format);
+    const uint bytesPerChannel = getFormatBytesPerBlock(format) / channelCount;
+    if (getFormatType(format) != FormatType::Float || channelCount < 3 || (bytesPerChannel != 4 && bytesPerChannel != 2))
+    {
+        logWarning("ProgressivePhotonMapping: unsupported env map format, env map photons use a unit radiance estimate.");
+        mEnvRadianceIntegral = 4.0f * (float)M_PI * pEnvMap->getIntensity();
+        return;
+    }
+
+    std::vector<uint8_t> texels = pRenderContext->readTextureSubresource(pTexture.get(), pTexture->getSubresourceIndex(0, mipLevel));
+    auto fetch = [&](uint index, uint channel)
+    {
+        const uint8_t* pTexel = texels.data() + (index * channelCount + channel) * bytesPerChannel;
+        return bytesPerChannel == 4 ? *(const float*)pTexel : glm::unpackHalf1x16(*(const uint16_t*)pTexel);
+    };
+
+    // Lat-long parameterization, dw = sin(theta) dtheta dphi.
+    const float3 luminanceWeights = pEnvMap->getTint() * float3(0.2126f, 0.7152f, 0.0722f);
+    double integral = 0.0;
+    for (uint y = 0; y < height; y++)
+    {
+        const double sinTheta = std::sin(M_PI * (y + 0.5) / height);
+        for (uint x = 0; x < width; x++)
+        {
+            const uint index = x + y * width;
+            const float3 radiance = float3(fetch(index, 0), fetch(index, 1), fetch(index, 2));
+            integral += glm::dot(radiance, luminanceWeights) * sinTheta;
+        }
+    }
+    mEnvRadianceIntegral = (float)(integral * (2.0 * M_PI / width) * (M_PI / height)) * pEnvMap->getIntensity();
+}
+
 void ProgressivePhotonMapping::generateVisiblePoints(RenderContext* pRenderContext, const RenderData& renderData)
 {
     PROFILE("Generate Hit Points");
 
     auto cb = mpGenerateVisiblePointsPass["CB"];
     setParamShaderData(cb["gGenerateVisiblePointsPass"]["params"]);
-    cb["gGenerateVisiblePointsPass"]["outputColor"] = renderData[kOutputChannels[0].name]->asTexture();
+    cb["gGenerateVisiblePointsPass"]["viewCameras"] = mpViewCameras;
     ShadingDataLoader::setShaderData(renderData, cb["gGenerateVisiblePointsPass"]["shadingDataLoader"]);
     cb["gGenerateVisiblePointsPass"]["visiblePoints"] = mpVisiblePoints;
     cb["gGenerateVisiblePointsPass"]["visiblePointsBoundingBoxBuffer"] = mpVisiblePointsBoundingBoxBuffer;
     cb["gGenerateVisiblePointsPass"]["visiblePointDensityContexts"] = mpVisiblePointDensityContexts;
+    cb["gGenerateVisiblePointsPass"]["visiblePointConvergenceContexts"] = mpVisiblePointConvergenceContexts;
     cb["gGenerateVisiblePointsPass"]["visiblePointPhotonNumbers"] = mpVisiblePointPhotonNumbers;
+    cb["gGenerateVisiblePointsPass"]["visiblePointsBounds"] = mpVisiblePointsBounds;
+    pRenderContext->clearUAV(mpVisiblePointsBounds->getUAV().get(), uint4(0));
 
     if (mpEnvMapSampler)
     {
@@ -320,24 +617,75 @@ void ProgressivePhotonMapping::generateVisiblePoints(RenderContext* pRenderConte
     mpSampleGenerator->setShaderData(mpGenerateVisiblePointsPass->getRootVar());
     mpScene->setRaytracingShaderData(pRenderContext, mpGenerateVisiblePointsPass->getRootVar());
 
-    mpGenerateVisiblePointsPass->execute(pRenderContext, mParams.frameDim.x, mParams.frameDim.y);
+    for (uint viewIndex = 0; viewIndex < mParams.viewCount; viewIndex++)
+    {
+        cb["gGenerateVisiblePointsPass"]["viewIndex"] = viewIndex;
+        cb["gGenerateVisiblePointsPass"]["outputColor"] = renderData[kOutputChannels[viewIndex].name]->asTexture();
+        mpGenerateVisiblePointsPass->execute(pRenderContext, mParams.frameDim.x, mParams.frameDim.y);
+    }
 
+    // One AS over the visible points of all views, so each photon pass deposits into every view.
     mpVisiblePointsAS->BuildAS(pRenderContext, 1u);
 }
 
+void ProgressivePhotonMapping::emitPhotons(RenderContext* pRenderContext, uint chunkIndex)
+{
+    PROFILE("Emit Photons");
+
+    const uint chunkSize = getPhotonChunkSize();
+    const uint chunkOffset = chunkIndex * chunkSize;
+    const uint chunkPhotonCount = std::min(chunkSize, mParams.photonPerDispatch - chunkOffset);
+
+    auto cb = mpEmitPhotonsPass["CB"];
+    setParamShaderData(cb["gEmitPhotonsPass"]["params"]);
+    cb["gEmitPhotonsPass"]["chunkOffset"] = chunkOffset;
+    cb["gEmitPhotonsPass"]["chunkSize"] = chunkPhotonCount;
+    cb["gEmitPhotonsPass"]["sortEmission"] = mSortEmission ? 1u : 0u;
+    cb["gEmitPhotonsPass"]["emissionSamples"] = mpEmissionSamples;
+    cb["gEmitPhotonsPass"]["emissionSortKeys"] = mpEmissionSortKeys;
+    cb["gEmitPhotonsPass"]["useEmissiveLights"] = mpEmissiveTable ? 1u : 0u;
+    cb["gEmitPhotonsPass"]["useEnvLight"] = mpEnvMapSampler ? 1u : 0u;
+    cb["gEmitPhotonsPass"]["emissivePower"] = mEmissivePower;
+    cb["gEmitPhotonsPass"]["envRadianceIntegral"] = mEnvRadianceIntegral;
+    cb["gEmitPhotonsPass"]["sceneBoundsMin"] = mpScene->getSceneBounds().minPoint;
+    cb["gEmitPhotonsPass"]["sceneBoundsMax"] = mpScene->getSceneBounds().maxPoint;
+    cb["gEmitPhotonsPass"]["visiblePointsBounds"] = mpVisiblePointsBounds;
+    if (mpEmissiveTable)
+    {
+        mpEmissiveTable->setShaderData(cb["gEmitPhotonsPass"]["emissiveTable"]);
+    }
+    if (mpEnvMapSampler)
+    {
+        mpEnvMapSampler->setShaderData(cb["gEmitPhotonsPass"]["envMapSampler"]);
+    }
+
+    mpSampleGenerator->setShaderData(mpEmitPhotonsPass->getRootVar());
+    mpScene->setRaytracingShaderData(pRenderContext, mpEmitPhotonsPass->getRootVar());
+
+    if (mSortEmission)
+    {
+        // Each group of 256 samples is sorted on its own, which keeps the sort cheap and the padding small.
+        const uint sortKeyCount = getEmissionSortKeyCount(chunkPhotonCount);
+        mpEmitPhotonsPass->execute(pRenderContext, sortKeyCount, 1u, 1u);
+        mpBitonicSort->execute(pRenderContext, mpEmissionSortKeys, sortKeyCount, kEmissionSortGroupSize, kEmissionSortGroupSize);
+    }
+    else
+    {
+        mpEmitPhotonsPass->execute(pRenderContext, chunkPhotonCount, 1u, 1u);
+    }
+}
+
 void ProgressivePhotonMapping::generatePhotons(RenderContext* pRenderContext, const RenderData& renderData)
 {
     PROFILE("Generate Photons");
 
     auto cb = mpGeneratePhotonsPass["CB"];
     setParamShaderData(cb["gGeneratePhotonsPass"]["params"]);
-    if (mpEmissiveTable)
-    {
-        mpEmissiveTable->setShaderData(cb["gGeneratePhotonsPass"]["emissiveTable"]);
-    }
     ShadingDataLoader::setShaderData(renderData, cb["gGeneratePhotonsPass"]["shadingDataLoader"]);
     cb["gGeneratePhotonsPass"]["visiblePoints"] = mpVisiblePoints;
     cb["gGeneratePhotonsPass"]["visiblePointDensityContexts"] = mpVisiblePointDensityContexts;
+    cb["gGeneratePhotonsPass"]["visiblePointConvergenceContexts"] = mpVisiblePointConvergenceContexts;
+    cb["gGeneratePhotonsPass"]["visiblePointsBoundingBoxBuffer"] = mpVisiblePointsBoundingBoxBuffer;
     cb["gGeneratePhotonsPass"]["visiblePointPhotonNumbers"] = mpVisiblePointPhotonNumbers;
 
     mpVisiblePointsAS->SetRaytracingShaderData(cb["gGeneratePhotonsPass"], "visiblePointsAS", 1u);
@@ -345,9 +693,24 @@ void ProgressivePhotonMapping::generatePhotons(RenderContext* pRenderContext, co
     mpSampleGenerator->setShaderData(mpGeneratePhotonsPass->getRootVar());
     mpScene->setRaytracingShaderData(pRenderContext, mpGeneratePhotonsPass->getRootVar());
 
-    mpGeneratePhotonsPass->execute(pRenderContext, mParams.photonPerDispatch, 1u, 1u);
+    cb["gGeneratePhotonsPass"]["sortEmission"] = mSortEmission ? 1u : 0u;
+    cb["gGeneratePhotonsPass"]["emissionSamples"] = mpEmissionSamples;
+    cb["gGeneratePhotonsPass"]["emissionSortKeys"] = mpEmissionSortKeys;
 
-    mParams.photonCount += mParams.photonPerDispatch;
+    // The photons of a pass are streamed through the budgeted emission buffers chunk by chunk.
+    const uint chunkSize = getPhotonChunkSize();
+    const uint chunkCount = getPhotonChunkCount();
+    for (uint chunkIndex = 0; chunkIndex < chunkCount; chunkIndex++)
+    {
+        emitPhotons(pRenderContext, chunkIndex);
+
+        const uint chunkOffset = chunkIndex * chunkSize;
+        const uint chunkPhotonCount = std::min(chunkSize, mParams.photonPerDispatch - chunkOffset);
+        cb["gGeneratePhotonsPass"]["chunkSize"] = chunkPhotonCount;
+        mpGeneratePhotonsPass->execute(pRenderContext, chunkPhotonCount, 1u, 1u);
+    }
+
+    mParams.photonCount += (float)mParams.photonPerDispatch;
     mParams.photonPassIndex++;
 }
 
@@ -357,15 +720,22 @@ void ProgressivePhotonMapping::reduceRadius(RenderContext* pRenderContext, const
 
     auto cb = mpReduceRadiusPass["CB"];
     setParamShaderData(cb["gReduceRadiusPass"]["params"]);
-    ShadingDataLoader::setShaderData(renderData, cb["gReduceRadiusPass"]["shadingDataLoader"]);
     cb["gReduceRadiusPass"]["visiblePoints"] = mpVisiblePoints;
     cb["gReduceRadiusPass"]["visiblePointDensityContexts"] = mpVisiblePointDensityContexts;
     cb["gReduceRadiusPass"]["visiblePointPhotonNumbers"] = mpVisiblePointPhotonNumbers;
+    cb["gReduceRadiusPass"]["visiblePointConvergenceContexts"] = mpVisiblePointConvergenceContexts;
+    cb["gReduceRadiusPass"]["convergenceStats"] = mpConvergenceStats;
 
-    mpSampleGenerator->setShaderData(mpReduceRadiusPass->getRootVar());
-    mpScene->setRaytracingShaderData(pRenderContext, mpReduceRadiusPass->getRootVar());
+    if (mTrackConvergence)
+    {
+        pRenderContext->clearUAV(mpConvergenceStats->getUAV().get(), uint4(0));
+    }
 
-    mpReduceRadiusPass->execute(pRenderContext, mParams.frameDim.x, mParams.frameDim.y);
+    // Large batches (8K, many views or samples per pixel) exceed the thread group limit of a 1D dispatch and are split into rows.
+    const uint visiblePointCount = (uint)mpVisiblePoints->getElementCount();
+    const uint dispatchWidth = std::min(visiblePointCount, kMaxDispatchWidth);
+    cb["gReduceRadiusPass"]["dispatchWidth"] = dispatchWidth;
+    mpReduceRadiusPass->execute(pRenderContext, dispatchWidth, div_round_up(visiblePointCount, dispatchWidth), 1u);
 }
 
 void ProgressivePhotonMapping::resolve(RenderContext* pRenderContext, const RenderData& renderData)
@@ -374,7 +744,6 @@ void ProgressivePhotonMapping::resolve(RenderContext* pRenderContext, const Rend
 
     auto cb = mpResolvePass["CB"];
     setParamShaderData(cb["gResolvePass"]["params"]);
-    cb["gResolvePass"]["outputColor"] = renderData[kOutputChannels[0].name]->asTexture();
     if (mpEnvMapSampler)
     {
         mpEnvMapSampler->setShaderData(cb["gResolvePass"]["envMapSampler"]);
@@ -383,14 +752,58 @@ void ProgressivePhotonMapping::resolve(RenderContext* pRenderContext, const Rend
     {
         mpEmissiveSampler->setShaderData(cb["gResolvePass"]["emissiveSampler"]);
     }
-    ShadingDataLoader::setShaderData(renderData, cb["gResolvePass"]["shadingDataLoader"]);
     cb["gResolvePass"]["visiblePoints"] = mpVisiblePoints;
     cb["gResolvePass"]["visiblePointDensityContexts"] = mpVisiblePointDensityContexts;
+    cb["gResolvePass"]["visiblePointConvergenceContexts"] = mpVisiblePointConvergenceContexts;
 
     mpSampleGenerator->setShaderData(mpResolvePass->getRootVar());
     mpScene->setRaytracingShaderData(pRenderContext, mpResolvePass->getRootVar());
 
-    mpResolvePass->execute(pRenderContext, mParams.frameDim.x, mParams.frameDim.y);
+    for (uint viewIndex = 0; viewIndex < mParams.viewCount; viewIndex++)
+    {
+        cb["gResolvePass"]["viewIndex"] = viewIndex;
+        cb["gResolvePass"]["outputColor"] = renderData[kOutputChannels[viewIndex].name]->asTexture();
+        mpResolvePass->execute(pRenderContext, mParams.frameDim.x, mParams.frameDim.y);
+    }
+}
+
+void ProgressivePhotonMapping::requestConvergenceStats(RenderContext* pRenderContext)
+{
+    PROFILE("Request Convergence Stats");
+
+    // All slots in flight, the oldest one has to be consumed before its buffer is reused.
+    readConvergenceStats(kConvergenceStatsReadbackCount - 1);
+
+    const uint slot = mConvergenceStatsRequested % kConvergenceStatsReadbackCount;
+    pRenderContext->copyResource(mpConvergenceStatsReadback[slot].get(), mpConvergenceStats.get());
+    pRenderContext->flush(false);
+    mConvergenceStatsFenceValues[slot] = mpConvergenceStatsFence->gpuSignal(pRenderContext->getLowLevelData()->getCommandQueue());
+    mConvergenceStatsFrames[slot] = mParams.frameCount;
+    mConvergenceStatsRequested++;
+}
+
+void ProgressivePhotonMapping::readConvergenceStats(uint maxPendingCount)
+{
+    // Consumes the readbacks in order. Waits only while more than maxPendingCount are in flight,
+    // after that it takes the ones the GPU already finished.
+    while (mConvergenceStatsRead < mConvergenceStatsRequested)
+    {
+        const uint slot = mConvergenceStatsRead % kConvergenceStatsReadbackCount;
+        if (mConvergenceStatsRequested - mConvergenceStatsRead > maxPendingCount)
+        {
+            mpConvergenceStatsFence->syncCpu(mConvergenceStatsFenceValues[slot]);
+        }
+        else if (mpConvergenceStatsFence->getCurrentValue() < mConvergenceStatsFenceValues[slot])
+        {
+            break;
+        }
+
+        const ConvergenceStats* pStats = (const ConvergenceStats*)mpConvergenceStatsReadback[slot]->map(Buffer::MapType::Read);
+        mConvergenceStats = *pStats;
+        mpConvergenceStatsReadback[slot]->unmap();
+        mConvergenceStatsFrame = mConvergenceStatsFrames[slot];
+        mConvergenceStatsRead++;
+    }
 }
 
 void ProgressivePhotonMapping::endFrame(RenderContext* pRenderContext, const RenderData& renderData)
@@ -29,6 +29,7 @@
 #include "Falcor.h"
 #include "Utils/Sampling/SampleGenerator.h"
 #include "Utils/Sampling/AliasTable.h"
+#include "Utils/Algorithm/BitonicSort.h"
 #include "Rendering/Lights/LightBVHSampler.h"
 #include "Rendering/Lights/EnvMapSampler.h"
 #include "Types.slang"
@@ -59,14 +60,31 @@ public:
     void recompile();
     bool prepareLighting(RenderContext* pRenderContext);
     void generateVisiblePoints(RenderContext* pRenderContext, const RenderData& renderData);
+    void emitPhotons(RenderContext* pRenderContext, uint chunkIndex);
     void generatePhotons(RenderContext* pRenderContext, const RenderData& renderData);
     void reduceRadius(RenderContext* pRenderContext, const RenderData& renderData);
     void resolve(RenderContext* pRenderContext, const RenderData& renderData);
     void endFrame(RenderContext* pRenderContext, const RenderData& renderData);
 
+    const ConvergenceStats& getConvergenceStats() const { return mConvergenceStats; }
+    float getFrameError() const { return mConvergenceStats.validCount > 0 ? mConvergenceStats.errorSum / mConvergenceStats.validCount : 1.0f; }
+    float getConvergedRatio() const { return mConvergenceStats.validCount > 0 ? (float)mConvergenceStats.convergedCount / mConvergenceStats.validCount : 0.0f; }
+    uint getPhotonPassesUsed() const { return mPhotonPassesUsed; }
+    bool isConverged() const { return mTargetError > 0.0f && getFrameError() < mTargetError; }
+    uint64_t getMemoryUsage() const;
+
 private:
+    static const uint kConvergenceStatsReadbackCount = 3; ///< Convergence stats readbacks that can be in flight at once.
+
     ProgressivePhotonMapping();
     void setParamShaderData(const ShaderVar& var);
+    void requestConvergenceStats(RenderContext* pRenderContext);
+    void readConvergenceStats(uint maxPendingCount);
+    void updateViews(const RenderData& renderData);
+    void updateEnvRadianceIntegral(RenderContext* pRenderContext);
+    uint getPhotonChunkSize() const;
+    uint getEmissionSortKeyCount(uint chunkSize) const;
+    uint getPhotonChunkCount() const { return (mParams.photonPerDispatch + getPhotonChunkSize() - 1) / getPhotonChunkSize(); }
 
     Scene::SharedPtr mpScene;
     SampleGenerator::SharedPtr mpSampleGenerator;
@@ -75,13 +93,26 @@ private:
     EnvMapSampler::SharedPtr mpEnvMapSampler;
     AliasTable::SharedPtr mpEmissiveTable;
 
+    std::vector<Camera::SharedPtr> mViewCameras;  ///< View 0 is the active camera, the rest are further scene cameras.
+    Buffer::SharedPtr mpViewCameras;
+
     Buffer::SharedPtr mpVisiblePoints;
     Buffer::SharedPtr mpVisiblePointPhotonNumbers;
     Buffer::SharedPtr mpVisiblePointDensityContexts;
+    Buffer::SharedPtr mpVisiblePointConvergenceContexts;
     Buffer::SharedPtr mpVisiblePointsBoundingBoxBuffer;
+    Buffer::SharedPtr mpVisiblePointsBounds;
+    Buffer::SharedPtr mpConvergenceStats;
+    Buffer::SharedPtr mpConvergenceStatsReadback[kConvergenceStatsReadbackCount];
+    GpuFence::SharedPtr mpConvergenceStatsFence;
     AccelerationStructureBuilder::SharedPtr mpVisiblePointsAS;
 
+    Buffer::SharedPtr mpEmissionSamples;  ///< Emission samples of one chunk, before tracing.
+    Buffer::SharedPtr mpEmissionSortKeys; ///< Sort keys of the emission samples, padded to whole sort groups.
+    BitonicSort::SharedPtr mpBitonicSort;
+
     ComputePass::SharedPtr mpGenerateVisiblePointsPass;
+    ComputePass::SharedPtr mpEmitPhotonsPass;
     ComputePass::SharedPtr mpGeneratePhotonsPass;
     ComputePass::SharedPtr mpSyncPhotonNumberPass;
     ComputePass::SharedPtr mpReduceRadiusPass;
@@ -91,5 +122,23 @@ private:
 
     PhotonMappingParams mParams;
     uint mPhotonPassNum = 10;
+    uint mSamplesPerPixel = 1u;         ///< Visible points per pixel, each with its own jittered camera path.
+    uint mViewCount = 1u;               ///< Requested number of views, the active count is limited by scene cameras and connected outputs.
     bool mRecompile = true;
+
+    bool mTrackConvergence = false;
+    bool mFreezeConverged = false;
+    uint mPhotonMemoryBudget = 64u;     ///< Budget in MB for the emission buffers. Passes with more photons are streamed through them in chunks.
+    bool mSortEmission = false;         ///< Sort emission samples by emitter and direction before tracing them.
+    float mTargetError = 0.0f;          ///< Stop the photon passes of a frame once the frame error drops below this. 0 disables.
+    uint mPhotonPassesUsed = 0u;        ///< Photon passes actually run in the last frame.
+    ConvergenceStats mConvergenceStats;
+    uint mConvergenceStatsFrame = 0u;   ///< Frame the current convergence stats were gathered in.
+    uint64_t mConvergenceStatsFenceValues[kConvergenceStatsReadbackCount] = {};
+    uint mConvergenceStatsFrames[kConvergenceStatsReadbackCount] = {};
+    uint mConvergenceStatsRequested = 0u; ///< Readbacks issued so far, slots are used round robin.
+    uint mConvergenceStatsRead = 0u;    ///< Readbacks consumed so far.
+
+    float mEmissivePower = 0.0f;        ///< Total flux of the mesh light triangles.
+    float mEnvRadianceIntegral = 0.0f;  ///< Env map luminance integrated over the sphere.
 };
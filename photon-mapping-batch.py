@@ -0,0 +1,89 @@
+"""
+Batch driver for ProgressivePhotonMapping.
+
+Run with Mogwai, e.g.
+    Mogwai.exe --script photon-mapping-batch.py --scene <scene> --silent
+
+Renders every configuration of the parameter grid below and writes one CSV row per
+configuration with the frame time, the photon throughput, the frame error and whether the
+target error was reached. With a target error each frame stops tracing photon passes once it
+is reached, so the frame time is the time-to-error of that configuration.
+"""
+import csv
+import itertools
+import os
+import time
+
+exec(open(os.path.join(os.path.dirname(os.path.abspath(__file__)), 'photon-mapping.py')).read())
+
+kPassName = 'ProgressivePhotonMapping'
+kOutputFile = os.environ.get('PPM_BATCH_OUTPUT', 'photon-mapping-batch.csv')
+kWarmupFrames = 4
+kMeasureFrames = 16
+
+# Options shared by all configurations.
+kBaseOptions = {
+    'trackConvergence': True,
+    'targetError': 0.01,
+    'photonPassCount': 20,
+}
+
+# Every combination of these options is rendered.
+kParameterGrid = {
+    'photonPerDispatch': [100000, 400000, 1600000],
+    'alpha': [0.5, 0.7, 0.9],
+    'initialRadius': [0.0025, 0.005, 0.01],
+    'maxPhotonBounces': [4, 10],
+    'sortPhotonEmission': [False, True],
+}
+
+def run_configuration(graph, options):
+    graph.updatePass(kPassName, options)
+    photonMapping = graph.getPass(kPassName)
+
+    for _ in range(kWarmupFrames):
+        m.renderFrame()
+
+    # Frames are timed together so the CPU/GPU latency of a single frame averages out.
+    photonCount = 0
+    frameError = 0.0
+    convergedFrames = 0
+    start = time.perf_counter()
+    for _ in range(kMeasureFrames):
+        m.renderFrame()
+        photonCount += options['photonPerDispatch'] * photonMapping.photonPassesUsed
+        frameError += photonMapping.frameError
+        convergedFrames += 1 if photonMapping.converged else 0
+    elapsed = time.perf_counter() - start
+
+    return {
+        'frameTimeMs': 1000.0 * elapsed / kMeasureFrames,
+        'photonsPerSecond': photonCount / elapsed,
+        'frameError': frameError / kMeasureFrames,
+        'convergedRatio': convergedFrames / kMeasureFrames,
+    }
+
+def run_batch():
+    graph = m.activeGraph
+    names = list(kParameterGrid.keys())
+    results = []
+    for values in itertools.product(*kParameterGrid.values()):
+        options = dict(kBaseOptions)
+        options.update(zip(names, values))
+        result = run_configuration(graph, options)
+        print(options, result)
+        results.append({**options, **result})
+
+    with open(kOutputFile, 'w', newline='') as f:
+        writer = csv.DictWriter(f, fieldnames=list(results[0].keys()))
+        writer.writeheader()
+        writer.writerows(results)
+
+    # The fastest configuration that reaches the target error in every measured frame.
+    converged = [r for r in results if r['convergedRatio'] == 1.0]
+    if converged:
+        best = min(converged, key=lambda r: r['frameTimeMs'])
+        print('Best configuration:', {name: best[name] for name in names})
+
+run_batch()
+exit()